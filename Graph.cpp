@@ -1,4 +1,5 @@
 #include "Graph.h"
+#include "writer.h"
 #include <boost/filesystem.hpp>
 
 using namespace boost::filesystem;
@@ -107,7 +108,15 @@ Graph *convert_file_to_graph_input(string file_path) {
 int main(int argc, char **argv) {
     if (argc < 2) {
         cerr << "No path to the data directory given!" << endl;
-        cerr << "Usage: " << argv[0] << " <path to directory>" << endl;
+        cerr << "Usage: " << argv[0] << " <path to directory> [output file] [binary|csv|json]" << endl;
+        return 1;
+    }
+
+    // The output file is only opened once there are results to write,
+    // so that an existing file survives invalid input.
+    string format = (argc >= 4) ? argv[3] : "binary";
+    if (argc >= 3 && !is_result_format(format)) {
+        cerr << "Unknown output format " << format << endl;
         return 1;
     }
     vector<string> files = get_files(argv[1]);
@@ -175,6 +184,53 @@ int main(int argc, char **argv) {
 
         cout << "Normalized Squared Error: " << error * 100.0 << " %" << endl;
         cout << "Pearson Correlation: " << corr << endl;
+        cout << endl;
+
+        if (argc >= 3) {
+            ResultWriter *writer = create_result_writer(argv[2], format);
+            if (writer == NULL) {
+                cerr << "Cannot write " << format << " output to " << argv[2] << endl;
+                return 1;
+            }
+            writer->write_pair(files[reference_file_index], files[test_file_index], y_axis_title, error, corr);
+            for (int i = 0; i < reference->getPeaks().size(); ++i)
+                writer->write_feature(files[reference_file_index], y_axis_title,
+                                      reference->getPeak_indices()[i], reference->getPeaks()[i]);
+            for (int i = 0; i < test->getPeaks().size(); ++i)
+                writer->write_feature(files[test_file_index], y_axis_title,
+                                      test->getPeak_indices()[i], test->getPeaks()[i]);
+            bool written = writer->close();
+            delete writer;
+            if (!written) {
+                cerr << "Failed to write " << format << " output to " << argv[2] << endl;
+                return 1;
+            }
+        }
+
+        int window = 0;
+        cout << "Enter the window size for local similarity (0 to skip): ";
+        cin >> window;
+
+        if (window > 0) {
+            long double threshold = 0.0;
+            cout << "Enter the local correlation threshold: ";
+            cin >> threshold;
+            cout << endl;
+
+            SimilarityProfile profile = reference->local_similarity(test->getY_axes()[processing_index], window);
+            if (profile.correlation.empty()) {
+                cerr << "Window size should be between 2 and the number of data points!" << endl;
+                return 1;
+            }
+
+            const vector<long double> &x_axis = reference->getX_axis();
+            cout << "Local Correlation below " << threshold << " (in " << x_axis_title << "): ";
+            vector<string> regions;
+            for (auto region : get_low_correlation_regions(profile, threshold))
+                regions.push_back(to_string((double) x_axis[region.first]) + " - " +
+                                  to_string((double) x_axis[region.second]));
+            cout << regions << endl;
+        }
 
     } else {
         cerr << "Check if both the inputs have same number of data points?" << endl;
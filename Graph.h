@@ -4,10 +4,27 @@
 #include <iostream>
 #include <cmath>
 #include <numeric>
+#include <thread>
+#include <utility>
 #include "filter.h"
 
+#define MIN_SEGMENT_SIZE 4096
+#define RESEED_RATIO 1e-8L
+
 using namespace std;
 
+/**
+ * Windowed comparison of two graphs.
+ *
+ * Entry i of each profile describes the window covering the data points
+ * [i, i + window - 1], so both profiles hold (n - window + 1) values.
+ */
+struct SimilarityProfile {
+    int window = 0;
+    vector<long double> correlation;
+    vector<long double> squared_error;
+};
+
 /**
  * This class represents an input for processing
  */
@@ -18,6 +35,7 @@ private:
     string x_axis_title;
     vector<string> y_axes_titles;
     vector<long double> peaks;
+    vector<int> peak_indices;
     int processing_index = -1;
 
 public:
@@ -43,6 +61,8 @@ public:
 
     const vector<long double> &getPeaks() const;
 
+    const vector<int> &getPeak_indices() const;
+
     void setProcessing_index(int processing_index);
 
     void process();
@@ -52,6 +72,8 @@ public:
     long double relative_error(vector<long double> other);
 
     long double correlation(vector<long double> other);
+
+    SimilarityProfile local_similarity(vector<long double> other, int window);
 };
 
 Graph::Graph() {}
@@ -110,6 +132,14 @@ const vector<long double> &Graph::getPeaks() const {
     return peaks;
 }
 
+/**
+ * Return indices of all peaks/troughs of the graph, in the same order as getPeaks()
+ * @return
+ */
+const vector<int> &Graph::getPeak_indices() const {
+    return peak_indices;
+}
+
 /**
  * This is core of the whole processing.
  *
@@ -139,20 +169,22 @@ void Graph::process() {
     vector<long double> y_bthreshed = apply_threshold(y_bth, average(y_bth));
     vector<long double> y_wthreshed = apply_threshold(y_wth, average(y_wth));
 
-    vector<int> peak_indices;
+    vector<int> indices;
     for (int peak : get_peak_indices(y_bthreshed)) {
         if (peak > 0 && peak < y_norm.size() - 1) {
-            peak_indices.push_back(local_search(y_norm, peak));
+            indices.push_back(local_search(y_norm, peak));
         }
     }
     for (int peak : get_peak_indices(y_wthreshed)) {
         if (peak > 0 && peak < y_norm.size() - 1) {
-            peak_indices.push_back(local_search(y_norm, peak));
+            indices.push_back(local_search(y_norm, peak));
         }
     }
 
-    for (auto index : peak_indices)
+    for (auto index : indices) {
+        Graph::peak_indices.push_back(index);
         Graph::peaks.push_back(y[index]);
+    }
 }
 
 /**
@@ -208,3 +240,183 @@ long double Graph::correlation(vector<long double> other) {
 
     return numerator / (sqrt(var_ref_y) * sqrt(var_other));
 }
+
+/**
+ * Fills the profile entries [begin, end) for two normalized inputs.
+ *
+ * The sums for the first window of the segment are computed directly and
+ * are then slid along the segment, adding the entering point and removing
+ * the leaving one. This makes every window O(1) instead of O(w).
+ *
+ * To keep the rounding drift of the running sums small, the values are
+ * shifted by the first value of the seeding window, the error is accumulated
+ * from the differences directly, and the sums are seeded again whenever a
+ * variance falls below RESEED_RATIO of the sums it is computed from. Flat
+ * windows are found exactly by counting the changes between neighbouring
+ * points instead of testing the variance.
+ *
+ * @param ref           const vector<long double> &
+ * @param other         const vector<long double> &
+ * @param w             int
+ * @param begin         size_t
+ * @param end           size_t
+ * @param profile       SimilarityProfile *
+ */
+void similarity_segment(const vector<long double> &ref, const vector<long double> &other, int w,
+                        size_t begin, size_t end, SimilarityProfile *profile) {
+    long double shift_r, shift_o;
+    long double sum_r, sum_o, sum_rr, sum_oo, sum_ro, sum_ref_sq, sum_diff_sq;
+    long double scale_r, scale_o;
+    int changes_r, changes_o;
+
+    auto seed = [&](size_t start) {
+        shift_r = ref[start];
+        shift_o = other[start];
+        sum_r = sum_o = sum_rr = sum_oo = sum_ro = sum_ref_sq = sum_diff_sq = 0.0;
+        changes_r = changes_o = 0;
+        for (size_t i = start; i < start + w; ++i) {
+            long double r = ref[i] - shift_r;
+            long double o = other[i] - shift_o;
+            sum_r += r;
+            sum_o += o;
+            sum_rr += r * r;
+            sum_oo += o * o;
+            sum_ro += r * o;
+            sum_ref_sq += ref[i] * ref[i];
+            sum_diff_sq += (ref[i] - other[i]) * (ref[i] - other[i]);
+            if (i > start) {
+                changes_r += ref[i] != ref[i - 1];
+                changes_o += other[i] != other[i - 1];
+            }
+        }
+        scale_r = sum_rr;
+        scale_o = sum_oo;
+    };
+
+    seed(begin);
+    for (size_t i = begin; i < end; ++i) {
+        if (i > begin) {
+            size_t in = i + w - 1;
+            size_t out = i - 1;
+            long double r_in = ref[in] - shift_r, r_out = ref[out] - shift_r;
+            long double o_in = other[in] - shift_o, o_out = other[out] - shift_o;
+            long double d_in = ref[in] - other[in], d_out = ref[out] - other[out];
+            sum_r += r_in - r_out;
+            sum_o += o_in - o_out;
+            sum_rr += r_in * r_in - r_out * r_out;
+            sum_oo += o_in * o_in - o_out * o_out;
+            sum_ro += r_in * o_in - r_out * o_out;
+            sum_ref_sq += ref[in] * ref[in] - ref[out] * ref[out];
+            sum_diff_sq += d_in * d_in - d_out * d_out;
+            changes_r += (ref[in] != ref[in - 1]) - (ref[out + 1] != ref[out]);
+            changes_o += (other[in] != other[in - 1]) - (other[out + 1] != other[out]);
+            scale_r = max(scale_r, sum_rr);
+            scale_o = max(scale_o, sum_oo);
+        }
+
+        if (changes_r == 0 || changes_o == 0) {
+            profile->correlation[i] = NAN;
+        } else {
+            long double var_r = sum_rr - sum_r * sum_r / w;
+            long double var_o = sum_oo - sum_o * sum_o / w;
+
+            // The rounding drift of the sums is relative to the largest sums
+            // seen since the last seed. Once a variance is that small, the
+            // sums are recomputed around the current window instead.
+            if (var_r < RESEED_RATIO * scale_r || var_o < RESEED_RATIO * scale_o) {
+                seed(i);
+                var_r = sum_rr - sum_r * sum_r / w;
+                var_o = sum_oo - sum_o * sum_o / w;
+            }
+
+            long double cov = sum_ro - sum_r * sum_o / w;
+            long double denominator = sqrt(max(var_r, (long double) 0.0)) * sqrt(max(var_o, (long double) 0.0));
+            long double corr = (denominator > 0.0) ? cov / denominator : NAN;
+            profile->correlation[i] = isnan(corr) ? corr : max(min(corr, (long double) 1.0), (long double) -1.0);
+        }
+
+        if (changes_r == 0 && ref[i] == 0.0)
+            profile->squared_error[i] = NAN;
+        else
+            profile->squared_error[i] = max(sum_diff_sq, (long double) 0.0) / sum_ref_sq;
+    }
+}
+
+/**
+ * Calculates the Pearson Correlation and the relative squared error of current
+ * graph with another graph over every window of the given size.
+ *
+ * The windows are split into segments of max(MIN_SEGMENT_SIZE, window) windows,
+ * each one starting from freshly computed sums, and the segments are shared
+ * among the threads. The segmentation does not depend on the number of threads,
+ * so the profile is the same on every host.
+ *
+ * A window with no variation in either graph has a NaN correlation, and a
+ * window where the reference stays at its minimum (all zero after
+ * normalisation) has a NaN squared error.
+ *
+ * @param other         vector<long double>
+ * @param window        int
+ * @return profile      SimilarityProfile (empty if window does not fit the data)
+ */
+SimilarityProfile Graph::local_similarity(vector<long double> other, int window) {
+    SimilarityProfile profile;
+    vector<long double> ref_y = normalize(Graph::y_axes[Graph::processing_index]);
+    vector<long double> other_norm = normalize(other);
+
+    size_t n = ref_y.size();
+    if (window < 2 || window > n || other_norm.size() != n)
+        return profile;
+
+    size_t windows = n - window + 1;
+    profile.window = window;
+    profile.correlation.resize(windows);
+    profile.squared_error.resize(windows);
+
+    // Reseeding costs O(window), so segments are never shorter than a window
+    size_t segment = max((size_t) MIN_SEGMENT_SIZE, (size_t) window);
+    size_t segments = (windows + segment - 1) / segment;
+    size_t threads = min((size_t) max(thread::hardware_concurrency(), 1u), segments);
+
+    auto worker = [&](size_t first) {
+        for (size_t s = first; s < segments; s += threads)
+            similarity_segment(ref_y, other_norm, window, s * segment,
+                               min((s + 1) * segment, windows), &profile);
+    };
+
+    vector<thread> workers;
+    for (size_t t = 1; t < threads; ++t)
+        workers.push_back(thread(worker, t));
+    worker(0);
+    for (auto &t : workers)
+        t.join();
+
+    return profile;
+}
+
+/**
+ * Returns the regions where the local correlation drops below a threshold.
+ *
+ * Consecutive windows below the threshold are merged, and every region is
+ * reported as the first and last data point index it covers. Windows with
+ * no variation (NaN correlation) are never counted as low.
+ *
+ * @param profile       const SimilarityProfile &
+ * @param threshold     long double
+ * @return regions      vector<pair<int, int>>
+ */
+vector<pair<int, int>> get_low_correlation_regions(const SimilarityProfile &profile, long double threshold) {
+    vector<pair<int, int>> regions;
+    int start = -1;
+    int n = (int) profile.correlation.size();
+    for (int i = 0; i <= n; ++i) {
+        bool is_low = i < n && !isnan(profile.correlation[i]) && profile.correlation[i] < threshold;
+        if (is_low && start < 0) {
+            start = i;
+        } else if (!is_low && start >= 0) {
+            regions.push_back(make_pair(start, i - 1 + profile.window - 1));
+            start = -1;
+        }
+    }
+    return regions;
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <algorithm>
 #include <deque>
+#include <limits>
 
 #define MAX_ITER 10
 
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#define BATCH_ROWS 65536
+#define RESULT_MAGIC "CMRS"
+#define RESULT_VERSION 1
+
+using namespace std;
+
+/**
+ * Interface for every output format of the comparison results.
+ *
+ * There are two kinds of records:
+ *  - pair:     metrics of a Reference/Test comparison on one column
+ *  - feature:  a single peak/trough (index and value) of one column of a file
+ */
+class ResultWriter {
+public:
+    virtual ~ResultWriter() {}
+
+    virtual void write_pair(const string &reference, const string &test, const string &column,
+                            long double error, long double correlation) = 0;
+
+    virtual void write_feature(const string &file, const string &column, int index, long double value) = 0;
+
+    virtual bool close() = 0;
+};
+
+/**
+ * Returns true iff the host stores numbers in little-endian byte order
+ * @return bool
+ */
+bool is_little_endian() {
+    uint16_t probe = 1;
+    unsigned char first;
+    memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+/**
+ * Returns the size of a file in bytes, or 0 if it does not exist
+ * @param file_path
+ * @return size
+ */
+streamoff file_size(const string &file_path) {
+    ifstream file(file_path, ios::binary | ios::ate);
+    return file.good() ? (streamoff) file.tellg() : 0;
+}
+
+/**
+ * A variable length string column stored as an offsets array and a single
+ * byte buffer, so that a whole column can be written in two calls.
+ */
+struct StringColumn {
+    vector<uint32_t> offsets = {0};
+    string data;
+
+    void push_back(const string &value) {
+        data += value;
+        offsets.push_back((uint32_t) data.size());
+    }
+
+    void clear() {
+        offsets.assign(1, 0);
+        data.clear();
+    }
+};
+
+/**
+ * Writes the results in a simple columnar binary format.
+ *
+ * Rows are buffered per column and written as a batch of at most BATCH_ROWS
+ * rows. An existing file is appended to, so the results of many runs build
+ * up in one file; it must start with the same header, else it is rejected.
+ * All numbers are little-endian, and are byte-swapped on big-endian hosts.
+ * The file starts with the 4 bytes "CMRS" and a uint32 version, followed by
+ * any number of batches:
+ *
+ *  uint32 table        0 = pair, 1 = feature
+ *  uint32 rows
+ *  columns in table order, each one either
+ *    float64/int32     rows values
+ *    string            (rows + 1) uint32 offsets, then offsets[rows] bytes
+ *
+ * pair:      reference (string), test (string), column (string),
+ *            relative_error (float64), correlation (float64)
+ * feature:   file (string), column (string), index (int32), value (float64)
+ */
+class BinaryResultWriter : public ResultWriter {
+private:
+    ofstream out;
+    bool little_endian = is_little_endian();
+
+    StringColumn pair_reference;
+    StringColumn pair_test;
+    StringColumn pair_column;
+    vector<double> pair_error;
+    vector<double> pair_correlation;
+
+    StringColumn feature_file;
+    StringColumn feature_column;
+    vector<int32_t> feature_index;
+    vector<double> feature_value;
+
+    template<typename T>
+    void write_column(const vector<T> &column) {
+        if (little_endian) {
+            out.write((const char *) column.data(), column.size() * sizeof(T));
+            return;
+        }
+        vector<char> swapped(column.size() * sizeof(T));
+        memcpy(swapped.data(), column.data(), swapped.size());
+        for (size_t i = 0; i < swapped.size(); i += sizeof(T))
+            reverse(swapped.begin() + i, swapped.begin() + i + sizeof(T));
+        out.write(swapped.data(), swapped.size());
+    }
+
+    void write_column(const StringColumn &column) {
+        write_column(column.offsets);
+        out.write(column.data.data(), column.data.size());
+    }
+
+    void write_batch_header(uint32_t table, size_t rows) {
+        write_column(vector<uint32_t>{table, (uint32_t) rows});
+    }
+
+    void flush_pairs() {
+        if (pair_error.empty())
+            return;
+        write_batch_header(0, pair_error.size());
+        write_column(pair_reference);
+        write_column(pair_test);
+        write_column(pair_column);
+        write_column(pair_error);
+        write_column(pair_correlation);
+        pair_reference.clear();
+        pair_test.clear();
+        pair_column.clear();
+        pair_error.clear();
+        pair_correlation.clear();
+    }
+
+    void flush_features() {
+        if (feature_index.empty())
+            return;
+        write_batch_header(1, feature_index.size());
+        write_column(feature_file);
+        write_column(feature_column);
+        write_column(feature_index);
+        write_column(feature_value);
+        feature_file.clear();
+        feature_column.clear();
+        feature_index.clear();
+        feature_value.clear();
+    }
+
+public:
+    BinaryResultWriter(const string &file_path) {
+        if (file_size(file_path) > 0) {
+            char header[8];
+            ifstream existing(file_path, ios::binary);
+            existing.read(header, sizeof(header));
+            uint32_t version;
+            memcpy(&version, header + 4, sizeof(version));
+            if (!little_endian)
+                reverse((char *) &version, (char *) &version + sizeof(version));
+            if (!existing || memcmp(header, RESULT_MAGIC, 4) != 0 || version != RESULT_VERSION)
+                return;
+            out.open(file_path, ios::binary | ios::app);
+        } else {
+            out.open(file_path, ios::binary | ios::app);
+            out.write(RESULT_MAGIC, 4);
+            write_column(vector<uint32_t>{RESULT_VERSION});
+        }
+    }
+
+    ~BinaryResultWriter() {
+        close();
+    }
+
+    bool good() const {
+        return out.is_open() && out.good();
+    }
+
+    void write_pair(const string &reference, const string &test, const string &column,
+                    long double error, long double correlation) {
+        pair_reference.push_back(reference);
+        pair_test.push_back(test);
+        pair_column.push_back(column);
+        pair_error.push_back((double) error);
+        pair_correlation.push_back((double) correlation);
+        if (pair_error.size() >= BATCH_ROWS)
+            flush_pairs();
+    }
+
+    void write_feature(const string &file, const string &column, int index, long double value) {
+        feature_file.push_back(file);
+        feature_column.push_back(column);
+        feature_index.push_back(index);
+        feature_value.push_back((double) value);
+        if (feature_index.size() >= BATCH_ROWS)
+            flush_features();
+    }
+
+    bool close() {
+        if (!out.is_open())
+            return true;
+        flush_pairs();
+        flush_features();
+        out.close();
+        return out.good();
+    }
+};
+
+/**
+ * Quotes a field for CSV if it contains a separator, quote or line break.
+ * @param value     string
+ * @return quoted   string
+ */
+string csv_quote(const string &value) {
+    if (value.find_first_of(",\"\r\n") == string::npos)
+        return value;
+    string quoted = "\"";
+    for (char c : value) {
+        if (c == '"')
+            quoted += '"';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+/**
+ * Returns the value as a JSON string literal.
+ * @param value     string
+ * @return quoted   string
+ */
+string json_quote(const string &value) {
+    string quoted = "\"";
+    for (char c : value) {
+        switch (c) {
+            case '"':
+                quoted += "\\\"";
+                break;
+            case '\\':
+                quoted += "\\\\";
+                break;
+            case '\n':
+                quoted += "\\n";
+                break;
+            case '\r':
+                quoted += "\\r";
+                break;
+            case '\t':
+                quoted += "\\t";
+                break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char escaped[7];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    quoted += escaped;
+                } else {
+                    quoted += c;
+                }
+        }
+    }
+    return quoted + "\"";
+}
+
+/**
+ * Returns the value for CSV, with non-finite values always spelled as
+ * nan, inf or -inf regardless of the platform.
+ * @param value     double
+ * @return text     string
+ */
+string csv_number(double value) {
+    if (isnan(value))
+        return "nan";
+    if (isinf(value))
+        return (value > 0) ? "inf" : "-inf";
+    char text[32];
+    snprintf(text, sizeof(text), "%.*g", numeric_limits<double>::max_digits10, value);
+    return text;
+}
+
+/**
+ * Returns the value for JSON, where NaN and infinity have no literal and
+ * are written as null.
+ * @param value     double
+ * @return text     string
+ */
+string json_number(double value) {
+    return isfinite(value) ? csv_number(value) : "null";
+}
+
+/**
+ * Writes the results as CSV, one record per line. The first field is the
+ * record kind and the remaining fields follow the binary column order:
+ *
+ *  pair,<reference>,<test>,<column>,<relative_error>,<correlation>
+ *  feature,<file>,<column>,<index>,<value>
+ *
+ * Non-finite values are written as nan, inf or -inf. An existing file is
+ * appended to.
+ */
+class CsvResultWriter : public ResultWriter {
+private:
+    ofstream out;
+
+public:
+    CsvResultWriter(const string &file_path) : out(file_path, ios::app) {}
+
+    ~CsvResultWriter() {
+        close();
+    }
+
+    bool good() const {
+        return out.is_open() && out.good();
+    }
+
+    void write_pair(const string &reference, const string &test, const string &column,
+                    long double error, long double correlation) {
+        out << "pair," << csv_quote(reference) << "," << csv_quote(test) << "," << csv_quote(column) << ","
+            << csv_number((double) error) << "," << csv_number((double) correlation) << "\n";
+    }
+
+    void write_feature(const string &file, const string &column, int index, long double value) {
+        out << "feature," << csv_quote(file) << "," << csv_quote(column) << "," << index << ","
+            << csv_number((double) value) << "\n";
+    }
+
+    bool close() {
+        if (!out.is_open())
+            return true;
+        out.close();
+        return out.good();
+    }
+};
+
+/**
+ * Writes the results as JSON Lines, one object per record with a "type"
+ * field of "pair" or "feature" and the binary column names as keys.
+ * Non-finite values (e.g. the correlation of a flat column) are written as null.
+ * An existing file is appended to.
+ */
+class JsonResultWriter : public ResultWriter {
+private:
+    ofstream out;
+
+public:
+    JsonResultWriter(const string &file_path) : out(file_path, ios::app) {}
+
+    ~JsonResultWriter() {
+        close();
+    }
+
+    bool good() const {
+        return out.is_open() && out.good();
+    }
+
+    void write_pair(const string &reference, const string &test, const string &column,
+                    long double error, long double correlation) {
+        out << "{\"type\": \"pair\", \"reference\": " << json_quote(reference)
+            << ", \"test\": " << json_quote(test)
+            << ", \"column\": " << json_quote(column)
+            << ", \"relative_error\": " << json_number((double) error)
+            << ", \"correlation\": " << json_number((double) correlation) << "}\n";
+    }
+
+    void write_feature(const string &file, const string &column, int index, long double value) {
+        out << "{\"type\": \"feature\", \"file\": " << json_quote(file)
+            << ", \"column\": " << json_quote(column)
+            << ", \"index\": " << index
+            << ", \"value\": " << json_number((double) value) << "}\n";
+    }
+
+    bool close() {
+        if (!out.is_open())
+            return true;
+        out.close();
+        return out.good();
+    }
+};
+
+/**
+ * Returns true iff the format is one create_result_writer() supports
+ * @param format
+ * @return bool
+ */
+bool is_result_format(const string &format) {
+    return format == "binary" || format == "csv" || format == "json";
+}
+
+/**
+ * Creates a writer for the given format ("binary", "csv" or "json").
+ * @param file_path
+ * @param format
+ * @return writer or NULL if the format is unknown or the file cannot be opened or
+ *         appended to
+ */
+ResultWriter *create_result_writer(const string &file_path, const string &format) {
+    if (format == "binary") {
+        BinaryResultWriter *writer = new BinaryResultWriter(file_path);
+        if (writer->good())
+            return writer;
+        delete writer;
+    } else if (format == "csv") {
+        CsvResultWriter *writer = new CsvResultWriter(file_path);
+        if (writer->good())
+            return writer;
+        delete writer;
+    } else if (format == "json") {
+        JsonResultWriter *writer = new JsonResultWriter(file_path);
+        if (writer->good())
+            return writer;
+        delete writer;
+    }
+    return NULL;
+}